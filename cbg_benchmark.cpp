@@ -0,0 +1,533 @@
+///////////////////////////////////////////////////////////////////////////////
+// Benchmark of Cuckoo Breeding Ground (CBG) hashtables, to catch performance
+// regressions before upgrading
+///////////////////////////////////////////////////////////////////////////////
+//
+// Written by Alain Espinosa <alainesp at gmail.com> in 2018 and placed
+// under the MIT license (see LICENSE file for a full definition).
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+// Sweeps the six public table types (Set/Map x SoA/AoS/AoB) x NUM_ELEMS_BUCKET
+// 2/3/4 x load factor x key type (uint32_t, uint64_t, 16 bytes POD and
+// std::string), with std::unordered_set/map as baseline. Keys with pointers
+// (std::string) only run on the SoA layout. With CBG_BENCHMARK_SWISS the
+// flat_hash_set/map of Abseil (a swiss table) are also a baseline.
+//
+// Operations: insert (filling an empty table of capacity 'num_bins' until
+// the load factor), positive lookup, negative lookup, erase-churn (erase one
+// elem and insert a new one) and rehash (reserve() to double capacity).
+// Tables may grow if they can't reach the load factor, the real one is
+// reported.
+//
+// Keys are a bijective mix of an index with a fixed seed, so runs are
+// reproducible and keys are unique (CBG insert() don't check duplicates).
+// Timing each operation alone would measure the clock: percentiles are of
+// the time by operation of groups of BATCH_SIZE operations.
+//
+// Output is CSV, to stdout or the file given:
+//   table,elems_bucket,key,target_load,load,operation,ns_op,p50,p90,p99,max
+//
+// With --latency each operation is timed alone with the cycle counter of the
+// CPU (rdtsc, cntvct on ARM64) in an HDR style histogram, to see the tail
+// hidden by the averages: kick chains and the rehash inside insert(). Sets
+// of uint64_t are filled until 99% of 'num_bins' (phase "fill", only grow
+// if an insert fails) and from a small table (phase "grow", growing at the
+// max_load_factor). Insert, find (positive and negative) and erase are
+// reported by bands of 5% of load, and each rehash with the load and time
+// of the insert that fired it:
+//   table,elems_bucket,phase,operation,load,count,p50,p99,p99.9,max
+// in nanoseconds, converted from the cycles measured.
+//
+// Build (C++14 or later):
+//   g++ -std=c++17 -O2 -DNDEBUG cbg_benchmark.cpp -o cbg_benchmark
+//   cl /std:c++17 /O2 /EHsc /DNDEBUG cbg_benchmark.cpp
+// With the swiss table baseline:
+//   g++ -std=c++17 -O2 -DNDEBUG -DCBG_BENCHMARK_SWISS cbg_benchmark.cpp -o cbg_benchmark -labsl_raw_hash_set -labsl_hash
+// Usage:
+//   cbg_benchmark [num_bins] [results.csv]
+//   cbg_benchmark --latency [num_bins] [results.csv]
+///////////////////////////////////////////////////////////////////////////////
+
+#include "cbg.hpp"
+#include <chrono>
+#include <unordered_set>
+#include <unordered_map>
+
+#if !defined(_MSC_VER) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+#ifdef CBG_BENCHMARK_SWISS
+#include <absl/container/flat_hash_set.h>
+#include <absl/container/flat_hash_map.h>
+#endif
+
+static constexpr uint64_t SEED = 0x2545F4914F6CDD1Dull;
+static constexpr uint64_t NEGATIVE_BASE = uint64_t(1) << 31;// Index of the first key not inserted
+static constexpr size_t BATCH_SIZE = 256;
+static const uint32_t table_loads[] = { 10, 25, 50, 70, 80, 90, 95, 99 };
+
+///////////////////////////////////////////////////////////////////////////////
+// Keys
+///////////////////////////////////////////////////////////////////////////////
+struct Key16
+{
+	uint64_t low;
+	uint64_t high;
+
+	bool operator==(const Key16& other) const noexcept
+	{
+		return low == other.low && high == other.high;
+	}
+};
+// Bijective mixes (splitmix64 and murmur3 finalizers): different indexes
+// give different keys
+static uint64_t mix64(uint64_t x) noexcept
+{
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+	return x ^ (x >> 31);
+}
+static uint32_t mix32(uint32_t x) noexcept
+{
+	x = (x ^ (x >> 16)) * 0x85EBCA6Bu;
+	x = (x ^ (x >> 13)) * 0xC2B2AE35u;
+	return x ^ (x >> 16);
+}
+// Key of index 'i'. Indexes from NEGATIVE_BASE are never inserted
+template<class KEY> KEY make_key(uint64_t i) noexcept;
+template<> uint32_t make_key<uint32_t>(uint64_t i) noexcept
+{
+	return mix32(uint32_t(SEED + i));
+}
+template<> uint64_t make_key<uint64_t>(uint64_t i) noexcept
+{
+	return mix64(SEED + i);
+}
+template<> Key16 make_key<Key16>(uint64_t i) noexcept
+{
+	return Key16{ mix64(SEED + i), i };
+}
+template<> std::string make_key<std::string>(uint64_t i) noexcept
+{
+	char hex[17];
+	snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)mix64(SEED + i));
+	return hex;
+}
+template<class KEY> const char* key_name();
+template<> const char* key_name<uint32_t>() { return "u32"; }
+template<> const char* key_name<uint64_t>() { return "u64"; }
+template<> const char* key_name<Key16>() { return "pod16"; }
+template<> const char* key_name<std::string>() { return "string"; }
+
+// Same hash for the baselines
+template<class KEY> struct Baseline_Hash
+{
+	cbg::hashing::t1ha2<KEY> hasher;
+
+	size_t operator()(const KEY& key) const noexcept
+	{
+		return size_t(hasher(key));
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Common interface of the tables
+///////////////////////////////////////////////////////////////////////////////
+template<class TABLE> using Is_Set = std::is_same<typename TABLE::key_type, typename TABLE::value_type>;
+
+template<class TABLE, class KEY> void insert_key(TABLE& table, const KEY& key, uint64_t /*i*/, std::true_type /*IS_SET*/)
+{
+	table.insert(key);
+}
+template<class TABLE, class KEY> void insert_key(TABLE& table, const KEY& key, uint64_t i, std::false_type /*IS_SET*/)
+{
+	table.insert(std::make_pair(key, i));
+}
+template<class TABLE, class KEY> void insert_key(TABLE& table, const KEY& key, uint64_t i)
+{
+	insert_key(table, key, i, Is_Set<TABLE>());
+}
+// Capacity: bins of CBG and swiss tables, buckets of std::unordered_*
+template<class TABLE> auto capacity_of(const TABLE& table, int) -> decltype(table.capacity())
+{
+	return table.capacity();
+}
+template<class TABLE> size_t capacity_of(const TABLE& table, long)
+{
+	return table.bucket_count();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Measures
+///////////////////////////////////////////////////////////////////////////////
+struct Measure
+{
+	std::vector<double> batches;// ns by operation of each batch
+	double total_ns = 0;
+	size_t num_ops = 0;
+
+	template<class FUNC> void run(size_t n, FUNC&& func)
+	{
+		for (size_t batch_init = 0; batch_init < n; batch_init += BATCH_SIZE)
+		{
+			size_t batch_end = std::min(n, batch_init + BATCH_SIZE);
+			auto start = std::chrono::steady_clock::now();
+			for (size_t i = batch_init; i < batch_end; i++)
+				func(i);
+			auto end = std::chrono::steady_clock::now();
+
+			double ns = double(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+			batches.push_back(ns / (batch_end - batch_init));
+			total_ns += ns;
+		}
+		num_ops += n;
+	}
+	double percentile(double p)
+	{
+		if (batches.empty())
+			return 0;
+		size_t index = std::min(batches.size() - 1, size_t(p * batches.size()));
+		std::nth_element(batches.begin(), batches.begin() + index, batches.end());
+		return batches[index];
+	}
+};
+
+static FILE* output = stdout;
+
+static void print_row(const char* table_name, size_t elems_bucket, const char* key, uint32_t target_load, double load, const char* operation, Measure& measure)
+{
+	fprintf(output, "%s,%u,%s,%u,%.2f,%s,%.2f,%.2f,%.2f,%.2f,%.2f\n", table_name, unsigned(elems_bucket), key, target_load, load, operation,
+		measure.num_ops ? measure.total_ns / measure.num_ops : 0.0, measure.percentile(0.5), measure.percentile(0.9), measure.percentile(0.99), measure.percentile(1.0));
+	fflush(output);
+}
+
+template<class TABLE> void benchmark(const char* table_name, size_t elems_bucket, size_t num_bins)
+{
+	using KEY = typename TABLE::key_type;
+
+	// Keys made before timing: std::string ones would measure the allocator
+	size_t max_elems = num_bins / 100 * 99;
+	std::vector<KEY> positive_keys, new_keys, negative_keys;
+	for (size_t i = 0; i < max_elems; i++)
+	{
+		positive_keys.push_back(make_key<KEY>(i));
+		new_keys.push_back(make_key<KEY>(max_elems + i));
+		negative_keys.push_back(make_key<KEY>(NEGATIVE_BASE + i));
+	}
+
+	for (uint32_t target_load : table_loads)
+	{
+		size_t num_elems = num_bins / 100 * target_load;
+		TABLE table(num_bins);
+		table.max_load_factor(1.f);
+
+		Measure insert;
+		insert.run(num_elems, [&](size_t i) { insert_key(table, positive_keys[i], i); });
+		double load = table.size() * 100. / capacity_of(table, 0);
+		print_row(table_name, elems_bucket, key_name<KEY>(), target_load, load, "insert", insert);
+
+		size_t num_found = 0;
+		Measure positive;
+		positive.run(num_elems, [&](size_t i) { num_found += table.count(positive_keys[i]); });
+		print_row(table_name, elems_bucket, key_name<KEY>(), target_load, load, "positive", positive);
+		if (num_found != num_elems)
+			fprintf(stderr, "Error: %s %s found %zu of %zu\n", table_name, key_name<KEY>(), num_found, num_elems);
+
+		num_found = 0;
+		Measure negative;
+		negative.run(num_elems, [&](size_t i) { num_found += table.count(negative_keys[i]); });
+		print_row(table_name, elems_bucket, key_name<KEY>(), target_load, load, "negative", negative);
+		if (num_found)
+			fprintf(stderr, "Error: %s %s found %zu negatives\n", table_name, key_name<KEY>(), num_found);
+
+		// Same number of elems, but the table changes
+		Measure churn;
+		churn.run(num_elems, [&](size_t i) {
+			table.erase(positive_keys[i]);
+			insert_key(table, new_keys[i], i);
+		});
+		print_row(table_name, elems_bucket, key_name<KEY>(), target_load, load, "erase_churn", churn);
+		if (table.size() != num_elems)
+			fprintf(stderr, "Error: %s %s size %zu after churn of %zu\n", table_name, key_name<KEY>(), size_t(table.size()), num_elems);
+
+		// By elem moved
+		Measure rehash;
+		auto start = std::chrono::steady_clock::now();
+		table.reserve(2 * capacity_of(table, 0));
+		auto end = std::chrono::steady_clock::now();
+		rehash.total_ns = double(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+		rehash.num_ops = std::max(size_t(1), num_elems);
+		rehash.batches.push_back(rehash.total_ns / rehash.num_ops);
+		print_row(table_name, elems_bucket, key_name<KEY>(), target_load, load, "rehash", rehash);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Latency of each operation (--latency)
+///////////////////////////////////////////////////////////////////////////////
+// Cycles of the CPU, as fast to read as possible. Nanoseconds of
+// steady_clock if there is no counter
+static __forceinline uint64_t read_ticks() noexcept
+{
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	// The fences don't let the operation measured move outside
+	_mm_lfence();
+	uint64_t ticks = __rdtsc();
+	_mm_lfence();
+	return ticks;
+#elif defined(__aarch64__)
+	uint64_t ticks;
+	__asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r"(ticks) : : "memory");
+	return ticks;
+#else
+	return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+// Nanoseconds by tick, measured against steady_clock
+static double ns_by_tick = 1;
+static uint64_t timer_overhead = 0;// Ticks of two reads with nothing between
+static void calibrate_ticks()
+{
+	auto start = std::chrono::steady_clock::now();
+	uint64_t start_ticks = read_ticks();
+	while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(100))
+	{}
+	uint64_t elapsed_ticks = read_ticks() - start_ticks;
+	ns_by_tick = double(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()) / elapsed_ticks;
+
+	timer_overhead = UINT64_MAX;
+	for (int i = 0; i < 10000; i++)
+	{
+		uint64_t t0 = read_ticks();
+		timer_overhead = std::min(timer_overhead, read_ticks() - t0);
+	}
+}
+
+// HDR style histogram: values below 2*SUB_BUCKETS are exact, then each
+// power of 2 has SUB_BUCKETS buckets (less than 3% of error)
+class Latency_Histogram
+{
+	static constexpr uint32_t SUB_BITS = 5;
+	static constexpr uint64_t SUB_BUCKETS = 1 << SUB_BITS;
+	static constexpr size_t SIZE = 2 * SUB_BUCKETS + (63 - SUB_BITS) * SUB_BUCKETS;
+
+	std::vector<uint64_t> counts;
+
+	static size_t index_of(uint64_t value) noexcept
+	{
+		if (value < 2 * SUB_BUCKETS)
+			return size_t(value);
+
+		uint32_t shift = 0;
+		while ((value >> shift) >= 2 * SUB_BUCKETS)
+			shift++;
+		return size_t(2 * SUB_BUCKETS + (shift - 1) * SUB_BUCKETS + ((value >> shift) - SUB_BUCKETS));
+	}
+	// Lowest value of the bucket
+	static uint64_t value_of(size_t index) noexcept
+	{
+		if (index < 2 * SUB_BUCKETS)
+			return index;
+
+		size_t shift = (index - 2 * SUB_BUCKETS) / SUB_BUCKETS + 1;
+		return ((index - 2 * SUB_BUCKETS) % SUB_BUCKETS + SUB_BUCKETS) << shift;
+	}
+
+public:
+	uint64_t total = 0;
+	uint64_t max = 0;
+
+	Latency_Histogram() : counts(SIZE)
+	{}
+	void add(uint64_t ticks) noexcept
+	{
+		ticks = ticks > timer_overhead ? ticks - timer_overhead : 0;
+		counts[index_of(ticks)]++;
+		total++;
+		max = std::max(max, ticks);
+	}
+	uint64_t percentile(double p) const noexcept
+	{
+		uint64_t rank = std::max(uint64_t(1), uint64_t(p * total + 0.5));
+		uint64_t count = 0;
+		for (size_t i = 0; i < SIZE; i++)
+		{
+			count += counts[i];
+			if (count >= rank)
+				return std::min(max, value_of(i));
+		}
+		return max;
+	}
+};
+
+enum Operation { OP_INSERT, OP_FIND_POSITIVE, OP_FIND_NEGATIVE, OP_ERASE, NUM_OPERATIONS };
+static const char* operation_names[NUM_OPERATIONS] = { "insert", "find_positive", "find_negative", "erase" };
+static constexpr uint32_t LOAD_BAND = 5;// Percent
+static constexpr size_t NUM_BANDS = 100 / LOAD_BAND + 1;
+
+static void print_latency(const char* table_name, size_t elems_bucket, const char* phase, const char* operation, double load, const Latency_Histogram& histogram)
+{
+	if (!histogram.total)
+		return;
+	fprintf(output, "%s,%u,%s,%s,%.2f,%llu,%.1f,%.1f,%.1f,%.1f\n", table_name, unsigned(elems_bucket), phase, operation, load, (unsigned long long)histogram.total,
+		histogram.percentile(0.5) * ns_by_tick, histogram.percentile(0.99) * ns_by_tick, histogram.percentile(0.999) * ns_by_tick, histogram.max * ns_by_tick);
+}
+
+// Insert 'num_elems' one by one, timing each one. After each 1/1000 of them
+// time some finds and erases (the elem erased is inserted again, not timed)
+template<class TABLE> void latency_phase(const char* table_name, size_t elems_bucket, const char* phase, TABLE& table, size_t num_elems)
+{
+	constexpr size_t NUM_PROBES = 16;
+	size_t probe_every = std::max(size_t(1), num_elems / 1000);
+	std::vector<Latency_Histogram> histograms(NUM_OPERATIONS * NUM_BANDS);
+	std::mt19937_64 r(SEED);
+	volatile size_t num_found = 0;// Lookups can't be removed
+
+	for (size_t i = 0; i < num_elems; i++)
+	{
+		size_t capacity = capacity_of(table, 0);
+		double load = table.size() * 100. / capacity;
+		size_t band = std::min(NUM_BANDS - 1, size_t(load) / LOAD_BAND);
+		uint64_t key = make_key<uint64_t>(i);
+
+		uint64_t start = read_ticks();
+		table.insert(key);
+		uint64_t ticks = read_ticks() - start;
+		histograms[OP_INSERT * NUM_BANDS + band].add(ticks);
+
+		// The insert that fired the rehash, exact time
+		if (capacity_of(table, 0) != capacity)
+		{
+			double ns = double(ticks > timer_overhead ? ticks - timer_overhead : 0) * ns_by_tick;
+			fprintf(output, "%s,%u,%s,rehash,%.2f,1,%.1f,%.1f,%.1f,%.1f\n", table_name, unsigned(elems_bucket), phase, load, ns, ns, ns, ns);
+		}
+
+		if (i % probe_every == 0)
+			for (size_t j = 0; j < NUM_PROBES; j++)
+			{
+				uint64_t positive_key = make_key<uint64_t>(r() % (i + 1));
+				uint64_t negative_key = make_key<uint64_t>(NEGATIVE_BASE + r() % num_elems);
+
+				start = read_ticks();
+				num_found = num_found + table.count(positive_key);
+				histograms[OP_FIND_POSITIVE * NUM_BANDS + band].add(read_ticks() - start);
+
+				start = read_ticks();
+				num_found = num_found + table.count(negative_key);
+				histograms[OP_FIND_NEGATIVE * NUM_BANDS + band].add(read_ticks() - start);
+
+				start = read_ticks();
+				table.erase(positive_key);
+				histograms[OP_ERASE * NUM_BANDS + band].add(read_ticks() - start);
+				table.insert(positive_key);
+			}
+	}
+
+	for (size_t op = 0; op < NUM_OPERATIONS; op++)
+		for (size_t band = 0; band < NUM_BANDS; band++)
+			print_latency(table_name, elems_bucket, phase, operation_names[op], double(band * LOAD_BAND), histograms[op * NUM_BANDS + band]);
+	fflush(output);
+}
+template<class TABLE> void latency(const char* table_name, size_t elems_bucket, size_t num_bins)
+{
+	{
+		TABLE table(num_bins);
+		table.max_load_factor(1.f);
+		latency_phase(table_name, elems_bucket, "fill", table, num_bins / 100 * 99);
+	}
+	{
+		TABLE table(1024);
+		latency_phase(table_name, elems_bucket, "grow", table, num_bins);
+	}
+}
+template<size_t NUM_ELEMS_BUCKET> void latency_cbg(size_t num_bins)
+{
+	latency<cbg::Set_SoA<NUM_ELEMS_BUCKET, uint64_t>>("Set_SoA", NUM_ELEMS_BUCKET, num_bins);
+	latency<cbg::Set_AoS<NUM_ELEMS_BUCKET, uint64_t>>("Set_AoS", NUM_ELEMS_BUCKET, num_bins);
+	latency<cbg::Set_AoB<NUM_ELEMS_BUCKET, uint64_t>>("Set_AoB", NUM_ELEMS_BUCKET, num_bins);
+}
+static void latency_all(size_t num_bins)
+{
+	calibrate_ticks();
+	fprintf(stderr, "%.3f ns by tick, timer overhead of %llu ticks\n", ns_by_tick, (unsigned long long)timer_overhead);
+
+	fprintf(output, "table,elems_bucket,phase,operation,load,count,p50,p99,p99.9,max\n");
+	latency_cbg<2>(num_bins);
+	latency_cbg<3>(num_bins);
+	latency_cbg<4>(num_bins);
+	latency<std::unordered_set<uint64_t, Baseline_Hash<uint64_t>>>("std::unordered_set", 0, num_bins);
+#ifdef CBG_BENCHMARK_SWISS
+	latency<absl::flat_hash_set<uint64_t, Baseline_Hash<uint64_t>>>("absl::flat_hash_set", 0, num_bins);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Tables of each key type
+///////////////////////////////////////////////////////////////////////////////
+template<size_t NUM_ELEMS_BUCKET, class KEY> void benchmark_cbg(size_t num_bins, std::true_type /*IS_TRIVIALLY_COPYABLE*/)
+{
+	benchmark<cbg::Set_SoA<NUM_ELEMS_BUCKET, KEY>>("Set_SoA", NUM_ELEMS_BUCKET, num_bins);
+	benchmark<cbg::Set_AoS<NUM_ELEMS_BUCKET, KEY>>("Set_AoS", NUM_ELEMS_BUCKET, num_bins);
+	benchmark<cbg::Set_AoB<NUM_ELEMS_BUCKET, KEY>>("Set_AoB", NUM_ELEMS_BUCKET, num_bins);
+	benchmark<cbg::Map_SoA<NUM_ELEMS_BUCKET, KEY, uint64_t>>("Map_SoA", NUM_ELEMS_BUCKET, num_bins);
+	benchmark<cbg::Map_AoS<NUM_ELEMS_BUCKET, KEY, uint64_t>>("Map_AoS", NUM_ELEMS_BUCKET, num_bins);
+	benchmark<cbg::Map_AoB<NUM_ELEMS_BUCKET, KEY, uint64_t>>("Map_AoB", NUM_ELEMS_BUCKET, num_bins);
+}
+// Elems with pointers need the SoA layout
+template<size_t NUM_ELEMS_BUCKET, class KEY> void benchmark_cbg(size_t num_bins, std::false_type /*IS_TRIVIALLY_COPYABLE*/)
+{
+	benchmark<cbg::Set_SoA<NUM_ELEMS_BUCKET, KEY>>("Set_SoA", NUM_ELEMS_BUCKET, num_bins);
+	benchmark<cbg::Map_SoA<NUM_ELEMS_BUCKET, KEY, uint64_t>>("Map_SoA", NUM_ELEMS_BUCKET, num_bins);
+}
+template<class KEY> void benchmark_key(size_t num_bins)
+{
+	benchmark_cbg<2, KEY>(num_bins, std::is_trivially_copyable<KEY>());
+	benchmark_cbg<3, KEY>(num_bins, std::is_trivially_copyable<KEY>());
+	benchmark_cbg<4, KEY>(num_bins, std::is_trivially_copyable<KEY>());
+
+	// Baselines
+	benchmark<std::unordered_set<KEY, Baseline_Hash<KEY>>>("std::unordered_set", 0, num_bins);
+	benchmark<std::unordered_map<KEY, uint64_t, Baseline_Hash<KEY>>>("std::unordered_map", 0, num_bins);
+#ifdef CBG_BENCHMARK_SWISS
+	benchmark<absl::flat_hash_set<KEY, Baseline_Hash<KEY>>>("absl::flat_hash_set", 0, num_bins);
+	benchmark<absl::flat_hash_map<KEY, uint64_t, Baseline_Hash<KEY>>>("absl::flat_hash_map", 0, num_bins);
+#endif
+}
+
+int main(int argc, char** argv)
+{
+	bool is_latency = argc > 1 && strcmp(argv[1], "--latency") == 0;
+	int arg = is_latency ? 2 : 1;
+
+	size_t num_bins = argc > arg ? size_t(strtoull(argv[arg], nullptr, 10)) : size_t(1) << 20;
+	if (num_bins < 100 || num_bins >= NEGATIVE_BASE / 2)
+	{
+		fprintf(stderr, "Usage: %s [--latency] [num_bins] [results.csv]\n  num_bins from 100 to %llu\n", argv[0], (unsigned long long)(NEGATIVE_BASE / 2 - 1));
+		return 1;
+	}
+	if (argc > arg + 1)
+	{
+		output = fopen(argv[arg + 1], "w");
+		if (!output)
+		{
+			fprintf(stderr, "Can't open %s\n", argv[arg + 1]);
+			return 1;
+		}
+	}
+
+	if (is_latency)
+		latency_all(num_bins);
+	else
+	{
+		fprintf(output, "table,elems_bucket,key,target_load,load,operation,ns_op,p50,p90,p99,max\n");
+		benchmark_key<uint32_t>(num_bins);
+		benchmark_key<uint64_t>(num_bins);
+		benchmark_key<Key16>(num_bins);
+		benchmark_key<std::string>(num_bins);
+	}
+
+	if (output != stdout)
+		fclose(output);
+	return 0;
+}
@@ -20,9 +20,17 @@ using set_negative_balanced	= cbg::Set_SoA<3, uint64_t>;// Set, faster negative
 using set_positive_fast		= cbg::Set_AoS<2, uint64_t>;// Set, faster positive queries, fastest (recommended load_factor < 60%)
 using set_positive_fat		= cbg::Set_AoS<4, uint64_t>;// Set, faster positive queries, little memory waste (when high load_factor, can reach 99%)
 using set_positive_balanced	= cbg::Set_AoS<3, uint64_t>;// Set, faster positive queries, balanced (recommended 60% < load_factor < 95%)
+// Integer keys can use a cheaper hash than the default t1ha2
+using set_integer_balanced	= cbg::Set_SoA<3, uint64_t, cbg::hashing::mult_xorshift_pair<uint64_t>>;
 // Similar for maps, one example:
 // ... other maps ...
-using map_positive_fast = cbg::Map_AoS<2, std::string, uint64_t>;// Map, faster positive queries, fast (recommended load_factor < 60%)
+using map_positive_fast = cbg::Map_AoS<2, uint64_t, uint64_t>;// Map, faster positive queries, fast (recommended load_factor < 60%)
+// Keys or values not trivially copyable (std::string, std::vector, ...) need the SoA layout
+using map_negative_balanced = cbg::Map_SoA<3, std::string, std::vector<uint64_t>, cbg::hashing::t1ha2_pair<std::string>, std::equal_to<>, true>;// Map, faster negative queries, balanced. Saved hashes: strings are expensive to hash
+#ifdef CBG_HAS_STRING_VIEW
+// String keys inline (up to 12 chars) or in one arena, not a std::string by key
+using map_string_balanced = cbg::String_Map_AoS<3, uint64_t>;
+#endif
 // ... other maps ...
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -97,12 +105,55 @@ void benchmark()
 	printf("Negative lookup time per elem: %u ns\n", uint32_t(elapsed.count() / cuckoo_table.size() / MAX_REPEAT));
 }
 
-void main()
+// Cache lines touched per lookup, with and without the cache line aware
+// reversal. As test_cache_lines() of research_cuckoo_cbg.cpp
+template<class TABLE> void benchmark_cache_lines(const char* name)
+{
+	const size_t MAX_BUCKETS = 100'000;
+	const uint32_t table_loads[] = { 50, 75, 90, 95 };
+
+	std::random_device good_random;
+	uint32_t seed = good_random();
+
+	printf("\n%s\n", name);
+	printf("----------------------------------------------\n");
+	printf("Table_Use   Reversal   Positive   Negative\n");
+	printf("----------------------------------------------\n");
+	for (uint32_t table_load : table_loads)
+		for (bool cache_line_reversal : { false, true })
+		{
+			TABLE cuckoo_table(MAX_BUCKETS);
+			cuckoo_table.max_load_factor(1.f);
+			cuckoo_table.cache_line_reversal(cache_line_reversal);
+
+			std::mt19937_64 r(seed);
+			while (cuckoo_table.size() < MAX_BUCKETS / 100 * table_load)
+				cuckoo_table.insert(r());
+
+			size_t positive_lines = 0;
+			std::mt19937_64 r_positive(seed);
+			for (size_t i = 0; i < cuckoo_table.size(); i++)
+				positive_lines += cuckoo_table.count_cache_lines(r_positive());
+
+			size_t negative_lines = 0;
+			for (size_t i = 0; i < cuckoo_table.size(); i++)
+				negative_lines += cuckoo_table.count_cache_lines(r());
+
+			printf("  %u%%        %-8s   %.3f      %.3f\n", table_load, cache_line_reversal ? "aware" : "normal",
+				positive_lines * 1. / cuckoo_table.size(), negative_lines * 1. / cuckoo_table.size());
+		}
+	printf("----------------------------------------------\n");
+}
+
+int main()
 {
 	benchmark();
+	benchmark_cache_lines<set_negative_fat>("Set_SoA<4, uint64_t>");
+	benchmark_cache_lines<set_positive_balanced>("Set_AoS<3, uint64_t>");
+	benchmark_cache_lines<set_positive_fat>("Set_AoS<4, uint64_t>");
 
 	// Wait for one keystroke
 	printf("\nPress any key to exit...");
-	char c;
-	scanf_s("%c", &c, 1);
+	getchar();
+	return 0;
 }
\ No newline at end of file
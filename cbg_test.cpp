@@ -0,0 +1,690 @@
+///////////////////////////////////////////////////////////////////////////////
+// Smoke and regression tests of Cuckoo Breeding Ground (CBG) hashtable
+///////////////////////////////////////////////////////////////////////////////
+//
+// Written by Alain Espinosa <alainesp at gmail.com> in 2018 and placed
+// under the MIT license (see LICENSE file for a full definition).
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+// Each public API checked against the std containers, with small tables so
+// the kicks, hopscotch, reversals, stash and rehashes happen. Note that
+// insert() don't look for the key, as in the tables, the tests only insert
+// new keys. Returns 1 if some check failed.
+//
+// Build (C++14 or later), also as C++14 at -O0: there the constants used by
+// reference need their definitions
+//   g++ -std=c++17 -O2 -pthread cbg_test.cpp -o cbg_test
+//   g++ -std=c++14 -O0 -pthread cbg_test.cpp -o cbg_test14
+// With the sanitizers (the AoS and AoB bins are packed, unaligned):
+//   g++ -std=c++17 -O1 -g -pthread -fsanitize=address,undefined -fno-sanitize=alignment cbg_test.cpp -o cbg_test
+// The readers and writers of Concurrent_Set_SoA, with the thread sanitizer:
+//   g++ -std=c++17 -O1 -g -pthread -fsanitize=thread cbg_test.cpp -o cbg_test_tsan
+///////////////////////////////////////////////////////////////////////////////
+
+#include "cbg.hpp"
+
+#include <random>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <unordered_map>
+#include <algorithm>
+#include <limits>
+#include <atomic>
+#include <thread>
+
+static uint32_t num_errors = 0;
+static void check(bool is_ok, const char* name, const char* what)
+{
+	if (!is_ok && num_errors++ < 50)
+		printf("ERROR %s: %s\n", name, what);
+}
+static const char* temp_path(const char* name)
+{
+	static std::string path;
+	path = std::string("cbg_test_") + name + ".tmp";
+	return path.c_str();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sets
+///////////////////////////////////////////////////////////////////////////////
+// Same elems and iteration as other set
+template<class TABLE> bool equal_to_reference(const TABLE& table, const std::unordered_set<uint64_t>& reference)
+{
+	if (table.size() != reference.size() || table.empty() != reference.empty())
+		return false;
+	for (uint64_t elem : reference)
+		if (table.count(elem) != 1)
+			return false;
+
+	size_t num_iterated = 0;
+	for (uint64_t elem : table)
+		if (reference.count(elem))
+			num_iterated++;
+	size_t num_for_each = 0;
+	table.for_each([&](uint64_t elem) { num_for_each += reference.count(elem); });
+
+	return num_iterated == reference.size() && num_for_each == reference.size();
+}
+// Random inserts and erases, many of them to repair the metadata
+template<class TABLE> void test_set(const char* name)
+{
+	std::mt19937_64 r(1);
+	std::unordered_set<uint64_t> reference;
+	TABLE table;
+
+	check(table.size() == 0 && table.empty() && table.count(1) == 0 && table.erase(1) == 0, name, "default constructed");
+	check(table.begin() == table.end(), name, "default constructed iteration");
+
+	for (uint32_t round = 0; round < 4; round++)
+	{
+		for (uint32_t i = 0; i < 20000; i++)
+		{
+			uint64_t elem = r() % 50000;
+			if (reference.insert(elem).second)
+				check(table.insert(elem), name, "insert");
+		}
+		for (uint32_t i = 0; i < 15000; i++)
+		{
+			uint64_t elem = r() % 50000;
+			check(table.erase(elem) == reference.erase(elem), name, "erase");
+		}
+		// Negative lookups
+		for (uint32_t i = 0; i < 1000; i++)
+			check(table.count(50000 + r()) == 0, name, "negative count");
+	}
+	check(equal_to_reference(table, reference), name, "same elems after inserts and erases");
+
+	// Batched lookups and inserts
+	std::vector<uint64_t> keys(1000);
+	for (uint64_t& key : keys)
+		key = r() % 100000;
+	std::vector<uint8_t> found(keys.size());
+	table.count_batch(keys.data(), keys.size(), found.data());
+	bool is_batch_ok = true;
+	for (size_t i = 0; i < keys.size(); i++)
+		is_batch_ok &= found[i] == table.count(keys[i]);
+	check(is_batch_ok, name, "count_batch");
+
+	for (size_t i = 0; i < keys.size(); i++)
+		keys[i] = 100000 + i * 3;
+	check(table.insert_batch(keys.data(), keys.size()), name, "insert_batch");
+	reference.insert(keys.begin(), keys.end());
+	check(equal_to_reference(table, reference), name, "insert_batch");
+
+	// Clear and grow from empty
+	table.clear();
+	reference.clear();
+	check(equal_to_reference(table, reference), name, "clear");
+	table.reserve(100000);
+	check(table.capacity() >= 100000, name, "reserve");
+	for (uint64_t i = 0; i < 1000; i++)
+		table.insert(i * 7919);
+	check(table.size() == 1000 && table.count(7919) == 1 && table.count(7918) == 0, name, "insert after clear");
+}
+// Near full tables use the stash and don't lose elems when growing
+template<class TABLE> void test_high_load(const char* name, float load)
+{
+	std::mt19937_64 r(2);
+	std::unordered_set<uint64_t> reference;
+	TABLE table(10000);
+	table.max_load_factor(1.f);
+
+	size_t num_elems = size_t(table.capacity() * load);
+	while (reference.size() < num_elems)
+	{
+		uint64_t elem = r();
+		if (reference.insert(elem).second)
+			table.insert(elem);
+	}
+	check(equal_to_reference(table, reference), name, "full table");
+
+	table.grow_factor(1.05f);
+	table.max_grow_factor(1.05f);
+	for (uint32_t i = 0; i < 20000; i++)
+	{
+		uint64_t elem = r();
+		if (reference.insert(elem).second)
+			table.insert(elem);
+	}
+	check(equal_to_reference(table, reference), name, "grown in small steps");
+	table.reserve(table.capacity() * 2);
+	check(equal_to_reference(table, reference), name, "reserve of a full table");
+}
+// Copies, moves and swap. A moved table is usable as a default constructed one
+template<class TABLE> void test_copy_move(const char* name)
+{
+	std::unordered_set<uint64_t> reference;
+	TABLE table;
+	for (uint64_t i = 0; i < 5000; i++)
+	{
+		table.insert(i * 31);
+		reference.insert(i * 31);
+	}
+
+	TABLE copy(table);
+	check(equal_to_reference(copy, reference) && equal_to_reference(table, reference), name, "copy constructor");
+	copy.insert(1);
+	check(table.count(1) == 0, name, "copies are independent");
+
+	TABLE assigned;
+	assigned.insert(2);
+	assigned = table;
+	check(equal_to_reference(assigned, reference), name, "copy assignment");
+	assigned = assigned;
+	check(equal_to_reference(assigned, reference), name, "self copy assignment");
+
+	TABLE moved(std::move(copy));
+	check(moved.size() == reference.size() + 1 && moved.count(1), name, "move constructor");
+	check(copy.size() == 0 && copy.count(1) == 0 && copy.erase(1) == 0 && copy.begin() == copy.end(), name, "moved from table is empty");
+	check(copy.insert(3) && copy.count(3) && copy.size() == 1, name, "moved from table is usable");
+
+	TABLE move_assigned;
+	move_assigned.insert(4);
+	move_assigned = std::move(moved);
+	check(move_assigned.count(1) && !move_assigned.count(4) && moved.empty(), name, "move assignment");
+	moved.clear();
+	moved.reserve(100);
+	check(moved.insert(5) && moved.count(5), name, "moved from table after reserve");
+
+	TABLE other;
+	other.insert(6);
+	other.swap(table);
+	check(equal_to_reference(other, reference) && table.size() == 1 && table.count(6), name, "swap");
+	std::swap(other, table);
+	check(equal_to_reference(table, reference) && other.count(6), name, "std::swap");
+}
+// Build all at once, at a load factor above the one of the inserts
+template<class TABLE> void test_bulk(const char* name, float target_load)
+{
+	std::mt19937_64 r(3);
+	std::vector<uint64_t> elems(20000);
+	for (uint64_t& elem : elems)
+		elem = r();
+
+	TABLE table(elems.data(), elems.data() + elems.size(), target_load);
+	std::unordered_set<uint64_t> reference(elems.begin(), elems.end());
+	check(equal_to_reference(table, reference), name, "bulk build");
+	check(table.load_factor() >= target_load * 99.f, name, "bulk build load factor");
+	table.insert(1);
+	reference.insert(1);
+	check(equal_to_reference(table, reference), name, "insert after bulk build");
+
+	TABLE empty(elems.data(), elems.data(), target_load);
+	check(empty.size() == 0 && empty.insert(1) && empty.count(1), name, "empty bulk build");
+
+	// Loads out of (0, 1] are clamped, load_factor() is in %
+	for (float bad_load : { 0.f, -1.f, 2.f, std::numeric_limits<float>::quiet_NaN(), 1e-30f })
+	{
+		TABLE clamped(elems.data(), elems.data() + 1000, bad_load);
+		check(clamped.size() == 1000 && clamped.load_factor() <= 100.f && clamped.capacity() <= 100001, name, "bulk build of a load out of (0, 1]");
+	}
+}
+// save() and open_mmap(), the mapped table is read only
+template<class TABLE, class OTHER_TABLE> void test_persistence(const char* name)
+{
+	const char* path = temp_path(name);
+	std::unordered_set<uint64_t> reference;
+	{
+		TABLE table;
+		for (uint64_t i = 0; i < 30000; i++)
+		{
+			table.insert(i * 13);
+			reference.insert(i * 13);
+		}
+		for (uint64_t i = 0; i < 1000; i++)
+		{
+			table.erase(i * 13);
+			reference.erase(i * 13);
+		}
+		check(table.save(path), name, "save");
+	}
+
+	TABLE mapped;
+	mapped.insert(1);
+	check(mapped.open_mmap(path) && mapped.is_mapped(), name, "open_mmap");
+	check(equal_to_reference(mapped, reference) && !mapped.count(1), name, "mapped table");
+
+	TABLE copy(mapped);
+	check(!copy.is_mapped() && equal_to_reference(copy, reference), name, "copy of a mapped table");
+	check(copy.insert(1) && copy.count(1), name, "the copy of a mapped table can be modified");
+	TABLE moved(std::move(mapped));
+	check(moved.is_mapped() && equal_to_reference(moved, reference), name, "move of a mapped table");
+
+	OTHER_TABLE other_layout;
+	check(!other_layout.open_mmap(path), name, "open_mmap of other layout");
+	check(!other_layout.open_mmap(temp_path("missing")), name, "open_mmap of a missing file");
+	std::remove(path);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Maps
+///////////////////////////////////////////////////////////////////////////////
+template<class MAP> bool equal_to_reference(const MAP& map, const std::unordered_map<uint64_t, uint64_t>& reference)
+{
+	if (map.size() != reference.size())
+		return false;
+	for (const auto& elem : reference)
+	{
+		const uint64_t* value = map.find(elem.first);
+		if (!value || *value != elem.second || map.at(elem.first) != elem.second)
+			return false;
+	}
+
+	size_t num_iterated = 0;
+	for (const auto& elem : map)
+	{
+		auto it = reference.find(elem.first);
+		num_iterated += it != reference.end() && it->second == elem.second;
+	}
+	return num_iterated == reference.size();
+}
+template<class MAP> void test_map(const char* name)
+{
+	std::mt19937_64 r(4);
+	std::unordered_map<uint64_t, uint64_t> reference;
+	MAP map;
+
+	check(map.find(1) == nullptr && map.count(1) == 0 && map.erase(1) == 0, name, "default constructed");
+	bool is_thrown = false;
+	try
+	{
+		map.at(1);
+	}
+	catch (const std::out_of_range&)
+	{
+		is_thrown = true;
+	}
+	check(is_thrown, name, "at() of a missing key throws");
+
+	for (uint32_t i = 0; i < 30000; i++)
+	{
+		uint64_t key = r() % 20000;
+		switch (i % 5)
+		{
+		case 0:
+			if (reference.insert(std::make_pair(key, uint64_t(i))).second)
+				check(map.insert(std::make_pair(key, uint64_t(i))), name, "insert");
+			break;
+		case 1:
+			map[key] = i;
+			reference[key] = i;
+			break;
+		case 2:
+			check(map.try_emplace(key, i).second == reference.emplace(key, i).second, name, "try_emplace");
+			break;
+		case 3:
+			check(*map.try_emplace(key, i).first == reference.emplace(key, i).first->second, name, "try_emplace existing");
+			break;
+		default:
+			check(map.erase(key) == reference.erase(key), name, "erase");
+		}
+	}
+	check(equal_to_reference(map, reference), name, "same elems");
+
+	// Values are modified in place
+	for (auto elem : map)
+		elem.second++;
+	for (auto& elem : reference)
+		elem.second++;
+	map.for_each([](uint64_t /*key*/, uint64_t& value) { value *= 2; });
+	for (auto& elem : reference)
+		elem.second *= 2;
+	check(equal_to_reference(map, reference), name, "modify by iterators and for_each()");
+
+	std::vector<uint64_t> keys(500);
+	for (uint64_t& key : keys)
+		key = r() % 40000;
+	std::vector<uint64_t*> values(keys.size());
+	map.find_batch(keys.data(), keys.size(), values.data());
+	bool is_batch_ok = true;
+	for (size_t i = 0; i < keys.size(); i++)
+		is_batch_ok &= values[i] == map.find(keys[i]);
+	check(is_batch_ok, name, "find_batch");
+
+	MAP copy(map);
+	MAP moved(std::move(map));
+	check(equal_to_reference(copy, reference) && equal_to_reference(moved, reference), name, "copy and move");
+	check(map.size() == 0 && map.find(1) == nullptr, name, "moved from map is empty");
+	map[7] = 8;
+	check(map.at(7) == 8, name, "moved from map is usable");
+}
+// Values not trivially copyable, only the SoA layout
+template<class MAP> void test_map_strings(const char* name)
+{
+	std::unordered_map<std::string, std::vector<uint64_t>> reference;
+	MAP map;
+	for (uint64_t i = 0; i < 5000; i++)
+	{
+		std::string key = "key number " + std::to_string(i % 3000);
+		map[key].push_back(i);
+		reference[key].push_back(i);
+	}
+	map.emplace(std::string("a key with a long name, no small string"), std::vector<uint64_t>(3, 1));
+	reference.emplace(std::string("a key with a long name, no small string"), std::vector<uint64_t>(3, 1));
+	for (uint64_t i = 0; i < 1000; i++)
+	{
+		std::string key = "key number " + std::to_string(i * 3);
+		check(map.erase(key) == reference.erase(key), name, "erase");
+	}
+
+	bool is_equal = map.size() == reference.size();
+	for (const auto& elem : reference)
+		is_equal &= map.find(elem.first) && *map.find(elem.first) == elem.second;
+	check(is_equal, name, "same elems");
+
+	// Transparent lookups
+	check(map.find("key number 1") && map.count("key number 1") && !map.count("key number 3"), name, "lookup by const char*");
+#ifdef CBG_HAS_STRING_VIEW
+	std::string_view view = "key number 1 and more";
+	check(map.at(view.substr(0, 12)) == reference["key number 1"], name, "lookup by std::string_view");
+	check(map.erase(view.substr(0, 12)) == 1 && !map.count("key number 1"), name, "erase by std::string_view");
+	reference.erase("key number 1");
+#endif
+
+	MAP copy(map);
+	MAP moved(std::move(map));
+	check(copy.size() == moved.size() && copy.size() == reference.size(), name, "copy and move");
+	check(map.empty() && map.try_emplace(std::string("new"), 1, 2).second && map.at("new").size() == 1, name, "moved from map is usable");
+}
+// Values out of the bins
+template<class MAP> void test_pool_map(const char* name)
+{
+	std::unordered_map<uint64_t, uint64_t> reference;
+	MAP map;
+	for (uint64_t i = 0; i < 20000; i++)
+	{
+		map[i % 7000] += i;
+		reference[i % 7000] += i;
+		if (i % 3 == 0)
+		{
+			map.erase(i % 5000);
+			reference.erase(i % 5000);
+		}
+	}
+	check(equal_to_reference(map, reference), name, "same elems");
+	check(map.pool_capacity() >= map.size(), name, "pool capacity");
+
+	MAP moved(std::move(map));
+	check(equal_to_reference(moved, reference) && map.size() == 0, name, "move");
+	check(map.try_emplace(1, 2).second && map.at(1) == 2, name, "moved from map is usable");
+}
+#ifdef CBG_HAS_STRING_VIEW
+// String keys inline or in the arena
+template<class MAP> void test_string_map(const char* name)
+{
+	std::unordered_map<std::string, uint64_t> reference;
+	MAP map;
+	for (uint64_t i = 0; i < 20000; i++)
+	{
+		// Short (inline) and long (arena) strings
+		std::string key = (i % 2 ? "k" : "a key too long to be inlined ") + std::to_string(i % 6000);
+		map[key] = i;
+		reference[key] = i;
+		if (i % 4 == 0)
+		{
+			std::string erased = (i % 8 ? "k" : "a key too long to be inlined ") + std::to_string(i % 3000);
+			check(map.erase(erased) == reference.erase(erased), name, "erase");
+		}
+	}
+
+	bool is_equal = map.size() == reference.size();
+	for (const auto& elem : reference)
+		is_equal &= map.find(elem.first) && *map.find(elem.first) == elem.second;
+	size_t num_iterated = 0;
+	for (const auto& elem : map)
+		num_iterated += reference.count(std::string(elem.first.data(), elem.first.size())) == 1;
+	check(is_equal && num_iterated == reference.size(), name, "same elems");
+	check(map.insert("new key", 1) && map.at("new key") == 1, name, "insert");
+
+	MAP copy(map);
+	MAP moved(std::move(map));
+	check(copy.size() == moved.size() && copy.at("new key") == 1 && moved.at("new key") == 1, name, "copy and move");
+	check(map.empty() && !map.find("new key") && map.insert("other", 3) && map.at("other") == 3, name, "moved from map is usable");
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Others
+///////////////////////////////////////////////////////////////////////////////
+template<class FILTER> void test_filter(const char* name)
+{
+	std::mt19937_64 r(5);
+	std::vector<uint64_t> elems(9000);
+	FILTER filter(10000);
+	for (uint64_t& elem : elems)
+	{
+		elem = r();
+		check(filter.insert(elem), name, "insert");
+	}
+	for (size_t i = 0; i < elems.size(); i += 2)
+		check(filter.erase(elems[i]) == 1, name, "erase");
+
+	bool no_false_negatives = true;
+	for (size_t i = 1; i < elems.size(); i += 2)
+		no_false_negatives &= filter.count(elems[i]) == 1;
+	check(no_false_negatives && filter.size() == elems.size() / 2, name, "no false negatives");
+
+	size_t num_false_positives = 0;
+	for (uint32_t i = 0; i < 100000; i++)
+		num_false_positives += filter.count(r());
+	check(num_false_positives < 1000, name, "false positive rate");
+	filter.clear();
+	check(filter.size() == 0 && filter.count(elems[1]) == 0, name, "clear");
+}
+template<class TABLE> void test_incremental(const char* name)
+{
+	std::unordered_set<uint64_t> reference;
+	cbg::Incremental_Rehash<TABLE> table;
+	bool was_migrating = false;
+	for (uint64_t i = 0; i < 100000; i++)
+	{
+		table.insert(i * 3);
+		reference.insert(i * 3);
+		was_migrating |= table.is_migrating();
+		if (i % 7 == 0)
+		{
+			table.erase(i * 3 / 2);
+			reference.erase(i * 3 / 2);
+		}
+	}
+	check(was_migrating, name, "migrates");
+
+	bool is_equal = table.size() == reference.size();
+	for (uint64_t elem : reference)
+		is_equal &= table.count(elem) == 1;
+	check(is_equal, name, "same elems while migrating");
+	table.migrate(SIZE_MAX);
+	check(!table.is_migrating() && table.size() == reference.size() && table.count(3), name, "migrate() all");
+}
+template<class TABLE> void test_sharded(const char* name)
+{
+	std::vector<uint64_t> elems(50000);
+	for (uint64_t i = 0; i < elems.size(); i++)
+		elems[i] = i * 5;
+
+	cbg::Sharded<TABLE> table(elems.data(), elems.data() + elems.size() / 2, 0.9f, 4);
+	check(table.size() == elems.size() / 2, name, "bulk build");
+	table.insert_parallel(elems.data() + elems.size() / 2, elems.data() + elems.size(), 4);
+	check(table.size() == elems.size(), name, "insert_parallel");
+
+	bool is_found = true;
+	for (uint64_t elem : elems)
+		is_found &= table.count(elem) == 1 && table.count(elem + 1) == 0;
+	check(is_found, name, "count");
+	check(table.erase(5) == 1 && table.count(5) == 0 && table.size() == elems.size() - 1, name, "erase");
+}
+void test_hashers()
+{
+	// Equal for the sets to use them in place of other
+	cbg::hashing::t1ha2_pair<uint64_t> t1ha2;
+	uint64_t keys[5] = { 1, 2, 3, 4, 5 };
+	std::pair<size_t, size_t> hashes[5];
+	t1ha2.hash_n(keys, 5, hashes);
+	bool is_equal = true;
+	for (size_t i = 0; i < 5; i++)
+		is_equal &= hashes[i] == t1ha2(keys[i]);
+	check(is_equal, "t1ha2_pair", "hash_n() equal to the hash of each key");
+	cbg::hashing::t1ha2_pair<std::string> t1ha2_string;
+	check(t1ha2_string(std::string("abc")) == t1ha2_string("abc"), "t1ha2_pair", "same hash of std::string and const char*");
+}
+void test_stats()
+{
+	cbg::Set_SoA<3, uint64_t> table;
+	for (uint64_t i = 0; i < 10000; i++)
+		table.insert(i);
+	table.count(7);
+	cbg::stats::Snapshot snapshot = table.stats();
+#ifdef CBG_STATS
+	check(snapshot.kick_chains > 0 && snapshot.lookups > 0 && snapshot.rehashes > 0, "stats", "counted");
+#else
+	check(snapshot.kick_chains == 0 && snapshot.lookups == 0, "stats", "compiled out");
+#endif
+	table.reset_stats();
+	check(table.stats().lookups == 0, "stats", "reset_stats()");
+}
+void test_concurrent()
+{
+	cbg::Concurrent_Set_SoA<4, uint64_t> table(20000);
+	std::unordered_set<uint64_t> reference;
+	for (uint64_t i = 0; i < 15000; i++)
+	{
+		table.insert(i * 11);
+		reference.insert(i * 11);
+		if (i % 5 == 0)
+		{
+			table.erase(i * 11 / 2);
+			reference.erase(i * 11 / 2);
+		}
+	}
+	bool is_equal = table.size() == reference.size();
+	for (uint64_t i = 0; i < 15000 * 11; i++)
+		is_equal &= table.count(i) == reference.count(i);
+	check(is_equal, "Concurrent_Set_SoA", "same elems");
+}
+// Writers insert and erase their own keys from a small table, so it grows
+// and is repaired while the readers look for keys never erased or inserted
+void test_concurrent_threads()
+{
+	const uint64_t NUM_STABLE = 20000, NUM_BY_WRITER = 100000, NUM_KEPT = 5000;
+	const uint32_t NUM_WRITERS = 4, NUM_READERS = 3;
+
+	cbg::Concurrent_Set_SoA<4, uint64_t> table(64);
+	for (uint64_t i = 0; i < NUM_STABLE; i++)
+		table.insert(i * 2);// The even ones
+
+	std::atomic<uint32_t> writers_running(NUM_WRITERS);
+	std::atomic<uint32_t> reader_errors(0), writer_errors(0);
+	std::vector<std::thread> threads;
+	for (uint32_t w = 0; w < NUM_WRITERS; w++)
+		threads.emplace_back([&, w] {
+			// Odd keys of his range, only the last NUM_KEPT remain
+			uint64_t first = NUM_STABLE * 2 + w * NUM_BY_WRITER * 2 + 1;
+			for (uint64_t i = 0; i < NUM_BY_WRITER; i++)
+			{
+				if (!table.insert(first + i * 2))
+					writer_errors++;
+				if (i >= NUM_KEPT && table.erase(first + (i - NUM_KEPT) * 2) != 1)
+					writer_errors++;
+			}
+			writers_running--;
+		});
+	for (uint32_t r = 0; r < NUM_READERS; r++)
+		threads.emplace_back([&, r] {
+			std::mt19937_64 rand(r);
+			do
+			{
+				uint64_t i = rand() % NUM_STABLE;
+				if (table.count(i * 2) != 1 || table.count(i * 2 + 1) != 0)// Odd ones before the writers range
+					reader_errors++;
+			} while (writers_running);
+		});
+	for (std::thread& thread : threads)
+		thread.join();
+
+	check(reader_errors == 0, "Concurrent_Set_SoA threads", "readers see the stable keys");
+	check(writer_errors == 0, "Concurrent_Set_SoA threads", "writers insert and erase");
+	bool is_equal = table.size() == NUM_STABLE + NUM_WRITERS * NUM_KEPT;
+	for (uint64_t i = 0; i < NUM_STABLE; i++)
+		is_equal &= table.count(i * 2) == 1;
+	for (uint32_t w = 0; w < NUM_WRITERS; w++)
+		for (uint64_t i = 0; i < NUM_BY_WRITER; i++)
+			is_equal &= table.count(NUM_STABLE * 2 + w * NUM_BY_WRITER * 2 + 1 + i * 2) == (i >= NUM_BY_WRITER - NUM_KEPT ? 1u : 0u);
+	check(is_equal, "Concurrent_Set_SoA threads", "same elems after the threads");
+}
+
+int main()
+{
+	using namespace cbg;
+	using mult = hashing::mult_xorshift_pair<uint64_t>;
+
+	test_set<Set_SoA<2, uint64_t>>("Set_SoA<2>");
+	test_set<Set_SoA<3, uint64_t>>("Set_SoA<3>");
+	test_set<Set_SoA<4, uint64_t>>("Set_SoA<4>");
+	test_set<Set_AoS<2, uint64_t>>("Set_AoS<2>");
+	test_set<Set_AoS<3, uint64_t>>("Set_AoS<3>");
+	test_set<Set_AoB<4, uint64_t>>("Set_AoB<4>");
+	test_set<Set_SoA<3, uint64_t, mult>>("Set_SoA<3> mult_xorshift");
+	test_set<Set_AoS<4, uint64_t, hashing::mult_split_pair<uint64_t>>>("Set_AoS<4> mult_split");
+	test_set<Set_SoA<4, uint64_t, mult, std::equal_to<>, true>>("Set_SoA<4> saved hashes");
+	test_set<Set_AoS<3, uint64_t, mult, std::equal_to<>, true>>("Set_AoS<3> saved hashes");
+	test_set<Set_SoA<3, uint64_t, mult, std::equal_to<>, false, memory::Aligned_Allocator<>, true>>("Set_SoA<3> spill filter");
+	test_set<Set_SoA<4, uint64_t, mult, std::equal_to<>, false, memory::Malloc_Allocator, false, 0>>("Set_SoA<4> 0 bits fingerprint");
+	test_set<Set_SoA<4, uint64_t, mult, std::equal_to<>, false, memory::Malloc_Allocator, false, 4>>("Set_SoA<4> 4 bits fingerprint");
+	test_set<Set_SoA<2, uint64_t, mult, std::equal_to<>, false, memory::Page_Allocator<>, false, 12>>("Set_SoA<2> 12 bits fingerprint");
+
+	test_high_load<Set_SoA<4, uint64_t>>("Set_SoA<4> high load", 0.99f);
+	test_high_load<Set_AoS<3, uint64_t>>("Set_AoS<3> high load", 0.97f);
+	test_high_load<Set_AoB<2, uint64_t>>("Set_AoB<2> high load", 0.88f);
+	test_high_load<Set_SoA<3, uint64_t, mult, std::equal_to<>, true>>("Set_SoA<3> saved hashes high load", 0.97f);
+	{
+		Set_AoS<4, uint64_t> table(10000);
+		table.cache_line_reversal(true);
+		check(table.cache_line_reversal() && table.count_cache_lines(uint64_t(1)) >= 1, "Set_AoS<4>", "cache_line_reversal()");
+	}
+
+	test_copy_move<Set_SoA<3, uint64_t>>("Set_SoA<3> copy");
+	test_copy_move<Set_AoS<2, uint64_t>>("Set_AoS<2> copy");
+	test_copy_move<Set_AoB<4, uint64_t>>("Set_AoB<4> copy");
+	test_copy_move<Set_SoA<4, uint64_t, mult, std::equal_to<>, true>>("Set_SoA<4> saved hashes copy");
+	test_copy_move<Set_SoA<4, uint64_t, mult, std::equal_to<>, false, memory::Malloc_Allocator, false, 4>>("Set_SoA<4> 4 bits fingerprint copy");
+
+	test_bulk<Set_SoA<4, uint64_t>>("Set_SoA<4> bulk", 0.99f);
+	test_bulk<Set_AoS<3, uint64_t>>("Set_AoS<3> bulk", 0.97f);
+	test_bulk<Set_AoB<2, uint64_t>>("Set_AoB<2> bulk", 0.9f);
+
+	test_persistence<Set_SoA<4, uint64_t>, Set_AoS<4, uint64_t>>("Set_SoA_4");
+	test_persistence<Set_AoS<3, uint64_t>, Set_AoS<2, uint64_t>>("Set_AoS_3");
+	test_persistence<Set_AoB<2, uint64_t>, Set_SoA<2, uint64_t>>("Set_AoB_2");
+	test_persistence<Set_SoA<3, uint64_t, mult, std::equal_to<>, true>, Set_SoA<3, uint64_t>>("Set_SoA_3_saved_hashes");
+
+	test_map<Map_SoA<3, uint64_t, uint64_t>>("Map_SoA<3>");
+	test_map<Map_AoS<4, uint64_t, uint64_t>>("Map_AoS<4>");
+	test_map<Map_AoB<2, uint64_t, uint64_t>>("Map_AoB<2>");
+	test_map<Map_SoA<4, uint64_t, uint64_t, mult, std::equal_to<>, true>>("Map_SoA<4> saved hashes");
+	test_map_strings<Map_SoA<3, std::string, std::vector<uint64_t>>>("Map_SoA<3> strings");
+	test_map_strings<Map_SoA<4, std::string, std::vector<uint64_t>, hashing::t1ha2_pair<std::string>, std::equal_to<>, true>>("Map_SoA<4> strings saved hashes");
+	test_pool_map<Pool_Map_SoA<4, uint64_t, uint64_t>>("Pool_Map_SoA<4>");
+	test_pool_map<Pool_Map_AoS<3, uint64_t, uint64_t>>("Pool_Map_AoS<3>");
+	test_pool_map<Pool_Map_AoB<2, uint64_t, uint64_t>>("Pool_Map_AoB<2>");
+#ifdef CBG_HAS_STRING_VIEW
+	test_string_map<String_Map_SoA<3, uint64_t>>("String_Map_SoA<3>");
+	test_string_map<String_Map_AoS<4, uint64_t>>("String_Map_AoS<4>");
+#endif
+
+	test_filter<Filter_SoA<4, uint64_t>>("Filter_SoA<4>");
+	test_filter<Filter_SoA<2, uint64_t, 8>>("Filter_SoA<2, 8 bits>");
+	test_incremental<Set_SoA<4, uint64_t>>("Incremental_Rehash<Set_SoA<4>>");
+	test_incremental<Set_AoS<3, uint64_t>>("Incremental_Rehash<Set_AoS<3>>");
+	test_sharded<Set_SoA<3, uint64_t>>("Sharded<Set_SoA<3>>");
+	test_sharded<Set_AoB<4, uint64_t>>("Sharded<Set_AoB<4>>");
+	test_hashers();
+	test_stats();
+	test_concurrent();
+	test_concurrent_threads();
+
+	printf("%u errors\n", num_errors);
+	return num_errors ? 1 : 0;
+}
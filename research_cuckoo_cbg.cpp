@@ -8,12 +8,19 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include <cstdint>
+#include <cinttypes>
 #include <tuple>
 #include <chrono>
 #include <random>
 #include <memory>
 #include <unordered_set>
 #include <cassert>
+#include <cstring>
+#include <cstdio>
+
+#if !defined(_MSC_VER)
+#define __forceinline inline __attribute__((always_inline))
+#endif
 
 ///////////////////////////////////////////////////////////////////////////////
 // Windowed Cucko hashing implemented as only one table. Contains 
@@ -962,7 +969,7 @@ void test_insertion_time()
 	}
 
 	for (uint32_t i = 0; i < 100; i++)
-		printf("%02u%% time: %I64u ns\n", i, times[i] / MAX_REPETITIONS);
+		printf("%02u%% time: %" PRIu64 " ns\n", i, times[i] / MAX_REPETITIONS);
 }
 
 void test_cache_lines()
@@ -1028,7 +1035,7 @@ void test_cache_lines()
 }
 
 
-void main()
+int main()
 {
 	//test_hashset();
 	//test_lmax();
@@ -1040,6 +1047,6 @@ void main()
 
 	// Wait for one keystroke
 	printf("\nPress any key to exit...");
-	char c;
-	scanf("%c", &c);
-}
\ No newline at end of file
+	getchar();
+	return 0;
+}
@@ -8,9 +8,12 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include <stdint.h>
+#include <inttypes.h>
 #include <algorithm>
 #include <numeric>
 #include <random>
+#include <string.h>
+#include <stdio.h>
 
 ///////////////////////////////////////////////////////////////////////////////
 // Cucko hashing insertion code (Random Walk and LSA_max) implemented as only
@@ -760,7 +763,7 @@ public:
 	}
 	uint32_t GetCapacity() const noexcept
 	{
-		return 4 * div.divisor;
+		return uint32_t(4 * num_buckets);
 	}
 	uint32_t GetNumElems() const noexcept
 	{
@@ -1128,11 +1131,11 @@ void test_insertion_time()
 	}
 
 	for (uint32_t i = 0; i < 100; i++)
-		printf("%02u%% time: %I64u ns\n", i, times[i] / MAX_REPETITIONS);
+		printf("%02u%% time: %" PRIu64 " ns\n", i, times[i] / MAX_REPETITIONS);
 }
 
 
-void main()
+int main()
 {
 	test_lmax();
 	//test_moves_done();
@@ -1142,6 +1145,6 @@ void main()
 
 	// Wait for one keystroke
 	printf("\nPress any key to exit...");
-	char c;
-	scanf("%c", &c);
-}
\ No newline at end of file
+	getchar();
+	return 0;
+}